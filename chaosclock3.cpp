@@ -1,18 +1,47 @@
+#include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <cerrno>
 #include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <random>
 #include <stack>
 #include <string>
+#include <thread>
 #include <vector>
 
+#if !defined(NO_PREFETCH) && defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace std;
 
 #define OBJECT_POOL_ENABLED
+#define CANONICAL_BOARD_MAP_ENABLED
 
 const int POOL_SIZE = 21000000;
 
+// The engine is templated on the clock size N: N slots and pieces 1 to N,
+// the odd ones for player 0 and the even ones for player 1. The real game is
+// N = 12, smaller clocks are variants for tests and scaling studies. Slot i
+// keeps its nibble at i << 2 and the player, lastmove, maxdeep and value
+// bits stay where they are for every N, so N is at most 12 and a uint16_t
+// still holds a bit per piece.
+const int CLOCK_SIZE = 12;
+
 template <typename T, size_t capacity = 128>
 class Stack
 {
@@ -101,26 +130,10 @@ struct Pieces
     uint8_t dead_size = 0;
 };
 
-typedef struct
-{
-    uint64_t b0 : 4;
-    uint64_t b1 : 4;
-    uint64_t b2 : 4;
-    uint64_t b3 : 4;
-    uint64_t b4 : 4;
-    uint64_t b5 : 4;
-    uint64_t b6 : 4;
-    uint64_t b7 : 4;
-    uint64_t b8 : 4;
-    uint64_t b9 : 4;
-    uint64_t b10 : 4;
-    uint64_t b11 : 4;
-} board_t;
-
 struct Position
 {
     uint64_t board = 0;
-    Stack<Position *, 12> children; // 24 Bytes
+    Stack<Position *, CLOCK_SIZE> children; // 24 Bytes
 };
 
 template <typename T>
@@ -134,16 +147,13 @@ public:
             throw std::bad_alloc();
         }
 
-        for (size_t i = 0; i < size; i++) {
-            new (&m_pool[i]) Position();
-        }
-
         m_size = size;
     }
 
     ~ObjectPool()
     {
-        for (size_t i = 0; i < m_size; i++) {
+        reset();
+        for (size_t i = 0; i < m_constructed; i++) {
             m_pool[i].~T();
         }
 
@@ -153,11 +163,29 @@ public:
     Position *acquire()
     {
         if (m_index < m_size) {
+            // built on first use, so the pages of an unused tail are never
+            // touched
+            if (m_index == m_constructed) {
+                new (&m_pool[m_constructed++]) T();
+            }
             return &m_pool[m_index++];
         } else {
             count++;
-            return new T();
+            m_overflow.push_back(new T());
+            return m_overflow.back();
+        }
+    }
+
+    // Hand out the whole pool again and free what went past its end. Only
+    // for a search whose positions are all dropped, such as one arena move.
+    void reset()
+    {
+        for (T *obj : m_overflow) {
+            delete obj;
         }
+        m_overflow.clear();
+        count = 0;
+        m_index = 0;
     }
 
     void release(T *obj)
@@ -167,29 +195,110 @@ public:
             std::swap(*obj, m_pool[m_index]);
         } else {
             count--;
+            m_overflow.erase(
+                std::find(m_overflow.begin(), m_overflow.end(), obj));
             delete obj;
         }
     }
 
+    // positions handed out past the end of the pool
     size_t count {0};
 
 private:
     T *m_pool {nullptr};
     size_t m_size {0};
     size_t m_index {0};
+    size_t m_constructed {0};
+    vector<T *> m_overflow;
 };
 
-ObjectPool<Position> positionPool(POOL_SIZE);
+// pool used by roll(); main, scale and every arena thread bring their own
+thread_local ObjectPool<Position> *searchPool = nullptr;
 
-const uint8_t pos24[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
-                         0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+// Pool for a search of up to nodes rolls. A roll keeps a bit over three
+// positions on large searches, more are taken from the heap.
+inline size_t poolSize(unsigned int nodes)
+{
+    return min<uint64_t>(4ull * nodes + 16, POOL_SIZE);
+}
+
+// board_map slots for a search of up to nodes rolls, a power of two that
+// keeps the map at most a quarter full
+inline uint64_t boardMapSize(uint64_t nodes)
+{
+    uint64_t map_size = 1 << 16;
+    while (map_size < 4 * nodes && map_size < (1ull << 27)) {
+        map_size <<= 1;
+    }
+    return map_size;
+}
+
+template <int N>
+struct PosWrap
+{
+    static_assert(N % 2 == 0 && N >= 4 && N <= 12, "unsupported clock size");
+    uint8_t pos[2 * N] {};
+    constexpr uint8_t operator[](int i) const { return pos[i]; }
+};
+
+template <int N>
+constexpr PosWrap<N> makePosWrap()
+{
+    PosWrap<N> wrap;
+    for (int i = 0; i < 2 * N; ++i) {
+        wrap.pos[i] = i % N;
+    }
+    return wrap;
+}
+
+// slot reached i steps after slot 0, for i < 2 * N (pos24 for N = 12)
+template <int N>
+constexpr PosWrap<N> pos2n = makePosWrap<N>();
+
+// bits of the pieces of player 0, by piece index
+template <int N>
+constexpr uint16_t oddPieces()
+{
+    uint16_t pieces = 0;
+    for (int i = 0; i < N; i += 2) {
+        pieces |= 1 << i;
+    }
+    return pieces;
+}
+
+// Values: 4 I win, 3 two win, 2 two lose, 1 I lose, 0 no result. A node
+// whose value rests on a node cut off by the depth or node cap only has an
+// estimate, which is the value it stands for with ESTIMATE_VALUE set;
+// ESTIMATE_VALUE alone is unclear. An estimate is never taken for a proven
+// result, so it never cuts off the siblings of a node.
+const uint8_t ESTIMATE_VALUE = 0x8;
+
+// Order of the values for the side to move. An estimated win or two win
+// ranks just below the proven one, an estimated loss or two lose just above
+// it, since it may still turn out better. Unclear ranks above every loss
+// and below every win.
+constexpr uint8_t value_rank[16] = {0, 1, 3, 7, 9, 0, 0, 0,
+                                    5, 2, 4, 6, 8, 0, 0, 0};
+
+// value of a node seen by the other player
+constexpr uint8_t flipValue(uint8_t value)
+{
+    return (value & 7) == 4   ? value - 3
+           : (value & 7) == 1 ? value + 3
+                              : value;
+}
 
 void coutBoard(uint64_t board, string c_name = "roll",
-               bool display_board = true)
+               bool display_board = true, int size = CLOCK_SIZE)
 {
     cout << c_name << "->";
     cout << "value: ";
-    cout << int(board >> 60);
+    if ((board >> 60) != ESTIMATE_VALUE) {
+        cout << int((board >> 60) & 7);
+    }
+    if ((board >> 60) & ESTIMATE_VALUE) {
+        cout << "?";
+    }
     cout << " ; player: ";
     cout << int((board >> 48) & 1);
     cout << " ; lastmove: ";
@@ -198,7 +307,7 @@ void coutBoard(uint64_t board, string c_name = "roll",
     cout << int((board >> 53) & 0b1111111);
     if (display_board) {
         cout << endl << " ; board: ";
-        for (int i = 0; i < 12; ++i) {
+        for (int i = 0; i < size; ++i) {
             cout << int((board >> (i << 2)) & 0xf);
             cout << ", ";
         }
@@ -219,124 +328,366 @@ void coutPieces(uint16_t piece, string c_name = "piece")
     cout << endl;
 }
 
-static uint64_t *board_map;
+static thread_local uint64_t *board_map;
+static thread_local uint32_t board_map_mask = 0x7ffffff;
+// With track_board_map, the private board_map slots filled since the last
+// newSearch(), so that it clears only those instead of the whole map.
+static thread_local bool track_board_map = false;
+static thread_local vector<uint32_t> board_map_used;
 // vector<Position*>board_map[4ll << 28];
 
-static const uint32_t random_board[12][13] = {
-    {0x0, 0x6B5D9A57, 0x597C92AA, 0x47B5BB4A, 0x7516EC1D, 0x234DD7DB,
-     0x115B60BD, 0x3E2BAA1D, 0x2D9F0408, 0x1AACC5C3, 0x48DE39FF, 0x76F7B9FF,
-     0x642CCB70},
-    {0x0, 0x48FDF0C9, 0x77EB9F9E, 0x24C18669, 0x13175B27, 0x40DE82D0,
-     0x6E2757B2, 0x5D36120E, 0x0B81373, 0x787854BD, 0x65A47DBD, 0x54B45F8D,
-     0x42733D6B},
-    {0x0, 0x279BAFC7, 0x15B47666, 0x4346DA58, 0x308A03A4, 0x1E1F6E67,
-     0x4D153B68, 0x7A64FA3C, 0x1A74B22A, 0x15A8DDE5, 0x044FBB6, 0x323E57C4,
-     0x18692549},
-    {0x0, 0x054C01FC, 0x72F8D76A, 0x61DA53D9, 0x4E7F9DC2, 0x7DCA8B0E,
-     0x2A16DD28, 0x18C31206, 0x6BFBDCF, 0x74D0FD2A, 0x61EE1CA9, 0x1061A22F,
-     0x7E8BCB99},
-    {0x0, 0x23AE8A21, 0x11202017, 0x3E0BFD2F, 0x6D34854A, 0x5B249E0D,
-     0x493F6A80, 0x363A8324, 0x244828BA, 0x1189ABE0, 0x7F8D0EBE, 0x2D270CF3,
-     0x1B7F34E1},
-    {0x0, 0x4137C4DC, 0x6E80BBA7, 0x5CB1C9F1, 0xB000176, 0x795BFFF3, 0x6677EB6E,
-     0x14DDF1DF, 0x24E8D51, 0x70B01B81, 0x6400D2A7, 0x4BD4CDAF, 0x7A29BCFB},
-    {0x0, 0x5F0B9CDE, 0xD4DEEAD, 0x3AB51BD4, 0x285C79A8, 0x56BEC85A, 0x4D4D4AA2,
-     0x1FFAD54F, 0x1F5A5C5F, 0x203C4F4, 0x1FF8D141, 0x7B56F27B},
-    {0x0, 0x3CCF0917, 0x6AEA010B, 0x18D654AF, 0x6D924C9, 0x74ACDCFE, 0x62E67A40,
-     0x9F55151, 0x3E958139, 0x6CFFDF88, 0x5925B1DA, 0x8A5B5C5, 0x750AF4FE},
-    {0x0, 0x5AFB5B1C, 0x964678D, 0x77B37F22, 0x245B5A2C, 0x5359D23, 0x408DCEFB,
-     0x6E44D26E, 0x1C2A7C79, 0xA43C1A6, 0x3846B8AC, 0x2703B3B3, 0x13D85E3C},
-    {0x0, 0x791E2234, 0x26723C91, 0x152C47A3, 0x1FBD61EB, 0x53251EB, 0x27D11AC1,
-     0x6E2F10EE, 0x1D8DA1F1, 0xA49C886, 0x3750805C, 0x98B3B4E, 0x4C4F6204},
-    {0x0, 0x78E0B5CD, 0x26FA20B5, 0x12F2C443, 0x1D32CE7C, 0x5DBF1BA6,
-     0x7A20B583, 0x73CF339, 0x3A6CC2EC, 0xA3F2C1A, 0x53A6EC9F, 0x6CCB728B,
-     0xF38FD63},
-    {0x0, 0x34385E0D, 0x45857C87, 0xB2572F2, 0x6482C09D, 0x45E2469C, 0x1681F64C,
-     0x5B4F4D33, 0x1A4E39F3, 0x5B5E5CB, 0x822A5A7, 0x23C1E2C1, 0x3A8E14C5},
+// Zobrist keys are generated at compile time from a fixed seed, so every
+// entry is filled and the hash is identical across builds. Index 0 of the
+// board and lastmove rows stands for "empty" and keeps a zero key, so the
+// slots a smaller clock leaves empty do not change its keys.
+struct ZobristKeys
+{
+    uint32_t board[CLOCK_SIZE][CLOCK_SIZE + 1] {};
+    uint32_t lastmove[16] {};
+    uint32_t player[2] {};
 };
 
-static const uint32_t random_lastmove[] = {0x0,        0x1BA50D3C, 0x399FB3AA,
-                                           0x576A48A7,
-                              0x35E3A4A8, 0x53F90D3,  0x316218A1, 0xF8C80D7,
-                              0x2CFDAAB7, 0xAB92EF2,  0x29210181, 0x71CCEE2,
-                              0x259A3472};
+// splitmix64
+constexpr uint64_t zobristRand(uint64_t &state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
 
-static const uint32_t random_player[] = {0x31C15271, 0x59AEEE46};
+constexpr uint32_t zobristKey(uint64_t &state)
+{
+    uint32_t key = 0;
+    while (key == 0) {
+        key = zobristRand(state) >> 32;
+    }
+    return key;
+}
 
-/*
-void setRandomBoard()
+constexpr ZobristKeys makeZobristKeys(uint64_t seed)
 {
-        for (uint32_t i = 0; i < 12; ++i) {
-                random_board[i][0] = 0;
-                for (uint32_t j = 1; j <= 12; ++j) {
-                        srand((i << 4) | j);
-                        random_board[i][j] = rand();
-                }
-        }
-        random_lastmove[0] = 0;
-        for (uint32_t i = 1; i <= 12; ++i) {
-                srand(i << 4);
-                random_lastmove[i] = rand();
+    ZobristKeys keys;
+    for (int i = 0; i < CLOCK_SIZE; ++i) {
+        for (int j = 1; j <= CLOCK_SIZE; ++j) {
+            keys.board[i][j] = zobristKey(seed);
         }
-        srand(0x0000ffff);
-        random_player[0] = rand();
-        srand(0xffff0000);
-        random_player[1] = rand();
+    }
+    for (int i = 1; i < 16; ++i) {
+        keys.lastmove[i] = zobristKey(seed);
+    }
+    keys.player[0] = zobristKey(seed);
+    keys.player[1] = zobristKey(seed);
+    return keys;
 }
-*/
 
+static constexpr ZobristKeys zobrist = makeZobristKeys(0x436861436c6f636bull);
+
+// Any N up to CLOCK_SIZE gives the same key as N = CLOCK_SIZE, the loop is
+// only shorter.
+template <int N = CLOCK_SIZE>
 uint32_t getBoardMapKey(uint64_t board)
 {
     // make the key
-    uint32_t key = random_board[0][board & 0xf] ^
-                   random_board[1][(board >> 4) & 0xf] ^
-                   random_board[2][(board >> 8) & 0xf] ^
-                   random_board[3][(board >> 12) & 0xf] ^
-                   random_board[4][(board >> 16) & 0xf] ^
-                   random_board[5][(board >> 20) & 0xf] ^
-                   random_board[6][(board >> 24) & 0xf] ^
-                   random_board[7][(board >> 28) & 0xf] ^
-                   random_board[8][(board >> 32) & 0xf] ^
-                   random_board[9][(board >> 36) & 0xf] ^
-                   random_board[10][(board >> 40) & 0xf] ^
-                   random_board[11][(board >> 44) & 0xf] ^
-                   random_player[(board >> 48) & 1] ^
-                   random_lastmove[(board >> 49) & 0xf];
+    uint32_t key = zobrist.player[(board >> 48) & 1] ^
+                   zobrist.lastmove[(board >> 49) & 0xf];
+    for (int i = 0; i < N; ++i) {
+        key ^= zobrist.board[i][(board >> (i << 2)) & 0xf];
+    }
     return key;
 }
 
-int8_t getBoardMap(uint64_t board)
+// Fetch the cache line at addr ahead of use; a no-op unless the build
+// enables prefetch (see the Makefile's prefetch option).
+inline void prefetch(const void *addr)
+{
+#ifndef NO_PREFETCH
+#ifdef _MSC_VER
+    _mm_prefetch((const char *)addr, _MM_HINT_T0);
+#else
+    __builtin_prefetch(addr);
+#endif
+#else
+    (void)addr;
+#endif
+}
+
+// Value of a node whose subtree was cut off by the node cap. It reads as a
+// miss, so the node is rolled again once there is budget for it.
+const uint64_t OPEN_VALUE = 0xf;
+// Value of a node while it is being rolled. On the path that rolls it, it
+// reads as no result, which ends cycles.
+const uint64_t ROLLING_VALUE = 0xe;
+
+// board_map may instead live in a named POSIX shared memory segment, so that
+// solver processes on one host publish and reuse each other's results. An
+// entry stays a single 64-bit word that only changes by compare-and-swap, so
+// a process that dies at any point leaves whole entries behind. The maxdeep
+// bits of a shared entry hold the slot of its writer, and a node that
+// another slot is still rolling counts as a miss.
+// A process holds its slot by a lock on byte <slot> of the segment, and
+// byte 0 guards the set up of the header. The kernel drops such locks when
+// a process dies, also across PID namespaces (such as containers that share
+// /dev/shm). Processes must see the same segment
+// file for that; segments on different hosts or mounts are unrelated.
+const uint32_t SHARED_MAP_MAGIC = 0x4d424343; // "CCBM"
+const uint32_t SHARED_MAP_VERSION = 4;
+const int SHARED_MAP_SLOTS = 128;
+// entries start on their own page
+const size_t SHARED_MAP_HEADER_SIZE = 4096;
+const uint64_t SHARED_SLOT_MASK = 0b1111111ll << 53;
+
+struct SharedMapHeader
+{
+    // 0 new, 2 ready
+    std::atomic<uint32_t> state;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t mask;
+    // boards of other clock sizes alias, so a segment holds one size
+    uint32_t clock;
+};
+
+static_assert(sizeof(SharedMapHeader) <= SHARED_MAP_HEADER_SIZE,
+              "shared board_map header does not fit");
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "shared board_map needs address-free atomics");
+
+static SharedMapHeader *shared_map = nullptr;
+static std::atomic<uint64_t> *shared_entries = nullptr;
+// holds the slot lock while attached
+static int shared_fd = -1;
+// slot of this process, in place; slot 0 is never handed out
+static uint64_t shared_slot = 0;
+
+int8_t getSharedBoardMap(uint64_t board, uint32_t key)
+{
+    uint64_t sb = board << 11;
+    for (int probe = 0; probe < 32; ++probe) {
+        uint64_t entry = shared_entries[key & board_map_mask].load(
+            std::memory_order_acquire);
+        if (entry == 0ll) {
+            return -1;
+        }
+        if (entry << 11 == sb) {
+            if (entry >> 60 == OPEN_VALUE ||
+                (entry >> 60 == ROLLING_VALUE &&
+                 (entry & SHARED_SLOT_MASK) != shared_slot)) {
+                return -1;
+            }
+            return entry >> 60 == ROLLING_VALUE ? 0 : entry >> 60;
+        }
+        key = key >> 1;
+    }
+    return -1;
+}
+
+void setSharedBoardMap(uint64_t board, uint32_t key)
+{
+    uint64_t sb = board << 11;
+    uint64_t new_entry = (board & ~SHARED_SLOT_MASK) | shared_slot;
+    for (int probe = 0; probe < 32; ++probe) {
+        std::atomic<uint64_t> &slot = shared_entries[key & board_map_mask];
+        uint64_t entry = slot.load(std::memory_order_relaxed);
+        // a failed swap reloads entry, which may now hold another board
+        while (entry == 0ll || entry << 11 == sb) {
+            if (slot.compare_exchange_weak(entry, new_entry,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        key = key >> 1;
+    }
+}
+
+bool attachSharedBoardMap(const string &name, int clock_size)
+{
+#ifdef _WIN32
+    cout << "Shared board_map is not supported on this platform" << endl;
+    return false;
+#else
+    size_t size = SHARED_MAP_HEADER_SIZE + (1ull << 27) * sizeof(uint64_t);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        cout << "Cannot open shared board_map " << name << endl;
+        return false;
+    }
+    // whoever comes first sizes it, a new segment reads as all zero
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size == 0 && ftruncate(fd, size) == -1) ||
+        (st.st_size != 0 && (size_t)st.st_size != size)) {
+        cout << "Shared board_map " << name << " has the wrong size" << endl;
+        close(fd);
+        return false;
+    }
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                      0);
+    if (addr == MAP_FAILED) {
+        cout << "Cannot map shared board_map " << name << endl;
+        close(fd);
+        return false;
+    }
+    shared_map = (SharedMapHeader *)addr;
+    shared_entries = (std::atomic<uint64_t> *)((char *)addr +
+                                               SHARED_MAP_HEADER_SIZE);
+    board_map = (uint64_t *)shared_entries;
+    board_map_mask = 0x7ffffff;
+
+    // set up the header under the lock on byte 0; if its first writer died
+    // half way the lock is free again and the next process redoes it
+    struct flock header_lock = {};
+    header_lock.l_type = F_WRLCK;
+    header_lock.l_whence = SEEK_SET;
+    header_lock.l_start = 0;
+    header_lock.l_len = 1;
+    while (fcntl(fd, F_SETLKW, &header_lock) == -1) {
+        if (errno != EINTR) {
+            cout << "Cannot lock shared board_map " << name << endl;
+            munmap(addr, size);
+            close(fd);
+            shared_map = nullptr;
+            return false;
+        }
+    }
+    if (shared_map->state.load() != 2) {
+        shared_map->magic = SHARED_MAP_MAGIC;
+        shared_map->version = SHARED_MAP_VERSION;
+        shared_map->mask = board_map_mask;
+        shared_map->clock = clock_size;
+        shared_map->state.store(2);
+    }
+    header_lock.l_type = F_UNLCK;
+    fcntl(fd, F_SETLK, &header_lock);
+    if (shared_map->magic != SHARED_MAP_MAGIC ||
+        shared_map->version != SHARED_MAP_VERSION ||
+        shared_map->mask != board_map_mask) {
+        cout << "Shared board_map " << name << " has another layout" << endl;
+        munmap(addr, size);
+        close(fd);
+        shared_map = nullptr;
+        return false;
+    }
+    if (shared_map->clock != (uint32_t)clock_size) {
+        cout << "Shared board_map " << name << " is for clock "
+             << shared_map->clock << endl;
+        munmap(addr, size);
+        close(fd);
+        shared_map = nullptr;
+        return false;
+    }
+
+    // take a slot that no live process holds
+    for (int i = 1; i < SHARED_MAP_SLOTS && shared_slot == 0; ++i) {
+        struct flock lock = {};
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        lock.l_start = i;
+        lock.l_len = 1;
+        if (fcntl(fd, F_SETLK, &lock) == 0) {
+            shared_slot = (uint64_t)i << 53;
+        }
+    }
+    if (shared_slot == 0) {
+        cout << "Shared board_map " << name << " has no free slot" << endl;
+        munmap(addr, size);
+        close(fd);
+        shared_map = nullptr;
+        return false;
+    }
+    shared_fd = fd;
+    // nodes left half rolled under this slot belong to nobody now
+    for (uint64_t i = 0; i <= board_map_mask; ++i) {
+        uint64_t entry = shared_entries[i].load(std::memory_order_relaxed);
+        if (entry >> 60 == ROLLING_VALUE &&
+            (entry & SHARED_SLOT_MASK) == shared_slot) {
+            shared_entries[i].compare_exchange_strong(
+                entry, entry & ~SHARED_SLOT_MASK);
+        }
+    }
+    cout << "shared board_map: " << name << ", slot "
+         << (shared_slot >> 53) << endl;
+    return true;
+#endif
+}
+
+// Leave the segment to the other processes, it lives until unlinked.
+void detachSharedBoardMap()
+{
+#ifndef _WIN32
+    munmap(shared_map,
+           SHARED_MAP_HEADER_SIZE + (1ull << 27) * sizeof(uint64_t));
+    // gives up the slot
+    close(shared_fd);
+    shared_fd = -1;
+    shared_slot = 0;
+    shared_map = nullptr;
+    shared_entries = nullptr;
+    board_map = nullptr;
+#endif
+}
+
+// Entry i of board_map, private or shared
+inline uint64_t boardMapAt(uint64_t i)
+{
+    if (shared_map != nullptr) {
+        return shared_entries[i].load(std::memory_order_relaxed);
+    }
+    return board_map[i];
+}
+
+// First slot probed for key
+inline const uint64_t *boardMapEntry(uint32_t key)
 {
-    uint32_t key = getBoardMapKey(board);
+    return &board_map[key & board_map_mask];
+}
+
+int8_t getBoardMap(uint64_t board, uint32_t key)
+{
+    if (shared_map != nullptr) {
+        return getSharedBoardMap(board, key);
+    }
     uint64_t sb = board << 11;
-    uint32_t masked_key = key & 0x7ffffff;
+    uint32_t masked_key = key & board_map_mask;
     while (board_map[masked_key] << 11 != sb) {
         if (board_map[masked_key] == 0ll) {
             return -1;
         }
         key = key >> 1;
-        masked_key = key & 0x7ffffff;
+        masked_key = key & board_map_mask;
+    }
+    if (board_map[masked_key] >> 60 == OPEN_VALUE) {
+        return -1;
+    }
+    if (board_map[masked_key] >> 60 == ROLLING_VALUE) {
+        return 0;
     }
     return board_map[masked_key] >> 60;
 }
 
-void setBoardMap(uint64_t board)
+void setBoardMap(uint64_t board, uint32_t key)
 {
-    uint32_t key = getBoardMapKey(board);
+    if (shared_map != nullptr) {
+        setSharedBoardMap(board, key);
+        return;
+    }
     uint64_t sb = board << 11;
-    uint32_t masked_key = key & 0x7ffffff;
-    uint64_t &board_entry = board_map[masked_key];
-    while (board_entry << 11 != sb) {
-        if (board_entry == 0ll) {
-            board_entry = board;
+    uint32_t masked_key = key & board_map_mask;
+    while (board_map[masked_key] << 11 != sb) {
+        if (board_map[masked_key] == 0ll) {
+            board_map[masked_key] = board;
+            if (track_board_map) {
+                board_map_used.push_back(masked_key);
+            }
             return;
         }
         key = key >> 1;
-        masked_key = key & 0x7ffffff;
-        board_entry = board_map[masked_key];
+        masked_key = key & board_map_mask;
     }
-    board_entry &= ~(0xfll << 60);
-    board_entry |= board >> 60 << 60;
+    board_map[masked_key] &= ~(0xfll << 60);
+    board_map[masked_key] |= board >> 60 << 60;
 }
 
 void coutMovelist(vector<uint8_t> &movelist)
@@ -349,37 +700,15 @@ void coutMovelist(vector<uint8_t> &movelist)
 }
 
 // indexOfBoard
+template <int N>
 int8_t iob(uint64_t board, uint8_t c)
 {
-    board_t *b = (board_t *)&board;
-
-    if (c == b->b0) {
-        return 0;
-    } else if (c == b->b1) {
-        return 1;
-    } else if (c == b->b2) {
-        return 2;
-    } else if (c == b->b3) {
-        return 3;
-    } else if (c == b->b4) {
-        return 4;
-    } else if (c == b->b5) {
-        return 5;
-    } else if (c == b->b6) {
-        return 6;
-    } else if (c == b->b7) {
-        return 7;
-    } else if (c == b->b8) {
-        return 8;
-    } else if (c == b->b9) {
-        return 9;
-    } else if (c == b->b10) {
-        return 10;
-    } else if (c == b->b11) {
-        return 11;
-    } else {
-        return -1;
+    for (int8_t i = 0; i < N; ++i) {
+        if (c == ((board >> (i << 2)) & 0xf)) {
+            return i;
+        }
     }
+    return -1;
 }
 
 // pieceOfBoard
@@ -388,12 +717,13 @@ inline uint8_t pob(uint64_t board, int8_t c_pos)
     return board >> (c_pos << 2) & 0xf;
 }
 
+template <int N>
 uint16_t getRunPos(uint64_t board, uint8_t c, int8_t c_pos)
 {
     uint16_t run_pos = 0;
     bool empty_in_run_pos = true;
     // while loop next pos
-    uint16_t next_pos = pos24[c_pos + c];
+    uint16_t next_pos = pos2n<N>[c_pos + c];
     uint8_t piece_of_next_pos = pob(board, next_pos);
     while (piece_of_next_pos != next_pos + 1) {
         run_pos |= (1 << next_pos);
@@ -412,52 +742,79 @@ uint16_t getRunPos(uint64_t board, uint8_t c, int8_t c_pos)
         if (piece_of_next_pos > 0) {
             empty_in_run_pos = false;
         }
-        next_pos = pos24[next_pos + c];
+        next_pos = pos2n<N>[next_pos + c];
         piece_of_next_pos = pob(board, next_pos);
     }
     return run_pos;
 }
 
-#define CB ((i ^ player) & 1)
-#define CBI ((~(i ^ player)) & 1)
-#define PCB (((i | p) ^ player) & 1)
-#define PCBI ((~((i | p) ^ player)) & 1)
+// Lastmove only matters when that piece could run again: a piece on its
+// stick, in hand or stuck never can, and neither can N for player 0. Such a
+// lastmove becomes 13, which keeps it apart from a pass (0) but merges all
+// the positions that have the same moves into one board_map entry.
+template <int N>
+uint64_t canonicalBoard(uint64_t board)
+{
+#ifdef CANONICAL_BOARD_MAP_ENABLED
+    uint8_t lastmove = (board >> 49) & 0xf;
+    if (lastmove == 0 || lastmove > N) {
+        return board;
+    }
+    int8_t c_pos = iob<N>(board, lastmove);
+    if (c_pos == -1 || c_pos + 1 == lastmove ||
+        (lastmove == N && !((board >> 48) & 1)) ||
+        getRunPos<N>(board, lastmove, c_pos) == 0) {
+        board &= ~(0xfll << 49);
+        board |= 13ll << 49;
+    }
+#endif
+    return board;
+}
+
+// Shift of the nibble that counts piece index i in the packed
+// (mine | yours << 4) sizes of Pieces. Player 0 is odd, 1 is even.
+template <uint8_t Player>
+constexpr uint8_t sideShift(uint8_t i)
+{
+    return ((i ^ Player) & 1) << 2;
+}
+
+// The half clock piece N / 2 (6) runs back and forth between two slots and
+// the full clock piece N (12) runs off the board, so neither counts for the
+// empty loops of the others.
+template <int N, uint8_t Player>
 Pieces piecesValue(uint64_t board)
 {
+    constexpr uint8_t half = N / 2;
     Pieces new_pieces;
-    uint8_t player = (board >> 48) & 1; // 0 is odd, 1 is even
     uint16_t run_pos_sum = 0, run_pos_sum_exp6 = 0;
     int8_t c6_pos;
     uint16_t run_empty_loop = 0, run_empty_loop_size = 0;
-    for (uint8_t i = 0; i < 12; ++i) {
+    for (uint8_t i = 0; i < N; ++i) {
         uint8_t c = i + 1;
-        int8_t c_pos = iob(board, c);
+        int8_t c_pos = iob<N>(board, c);
         // stick
         if (c == pob(board, i)) {
             new_pieces.stick |= (1 << i);
-            new_pieces.stick_size =
-                (new_pieces.stick_size & (0xf << (CBI << 2))) |
-                (((new_pieces.stick_size >> (CB << 2)) & 0xf) + 1) << (CB << 2);
+            new_pieces.stick_size += 1 << sideShift<Player>(i);
         }
         // hand
         else if (c_pos == -1) {
             new_pieces.hand |= (1 << i);
-            new_pieces.hand_size =
-                (new_pieces.hand_size & (0xf << (CBI << 2))) |
-                (((new_pieces.hand_size >> (CB << 2)) & 0xf) + 1) << (CB << 2);
+            new_pieces.hand_size += 1 << sideShift<Player>(i);
         }
         // run, stop
         else {
-            uint16_t c_run_pos = getRunPos(board, c, c_pos);
+            uint16_t c_run_pos = getRunPos<N>(board, c, c_pos);
             if (c_run_pos == 0) {
                 new_pieces.stop |= (1 << i);
             } else {
                 new_pieces.running |= (1 << i);
                 new_pieces.running_size++;
                 run_pos_sum |= c_run_pos;
-                if (c == 6) {
+                if (c == half) {
                     c6_pos = c_pos;
-                } else if (c != 12) {
+                } else if (c != N) {
                     run_pos_sum_exp6 |= c_run_pos;
                     run_empty_loop |= c_run_pos >> 15 << c >> 1;
                     run_empty_loop_size += c_run_pos >> 15;
@@ -468,16 +825,13 @@ Pieces piecesValue(uint64_t board)
     // free
     uint16_t mergehandfree = new_pieces.hand | new_pieces.free;
     for (uint8_t p = 0; p < 2; ++p) {
-        for (int8_t i = 0; i < 12; i += 2) {
+        for (int8_t i = 0; i < N; i += 2) {
             if ((new_pieces.stop >> (i | p)) & 1) {
                 uint8_t c = (i | p) + 1;
-                int8_t c_pos = iob(board, c);
+                int8_t c_pos = iob<N>(board, c);
                 if (!((p ^ c_pos) & 1) && (mergehandfree >> c_pos) & 1) {
                     new_pieces.free |= (1 << c) >> 1;
-                    new_pieces.free_size =
-                        (new_pieces.free_size & (0xf << (PCBI << 2))) |
-                        (((new_pieces.free_size >> (PCB << 2)) & 0xf) + 1)
-                            << (PCB << 2);
+                    new_pieces.free_size += 1 << sideShift<Player>(i | p);
                     new_pieces.stop &= ~((1 << c) >> 1);
                     mergehandfree = new_pieces.hand | new_pieces.free;
                     i = -2;
@@ -486,10 +840,10 @@ Pieces piecesValue(uint64_t board)
         }
     }
     // stock
-    for (uint8_t i = 0; i < 12; ++i) {
+    for (uint8_t i = 0; i < N; ++i) {
         if ((new_pieces.stop >> i) & 1) {
             uint8_t c = i + 1;
-            int8_t c_pos = iob(board, c);
+            int8_t c_pos = iob<N>(board, c);
             if (!((run_pos_sum >> c_pos) & 1)) {
                 new_pieces.stock |= (1 << c) >> 1;
                 new_pieces.stop &= ~((1 << c) >> 1);
@@ -497,41 +851,33 @@ Pieces piecesValue(uint64_t board)
         }
     }
     // dead
-    for (int8_t i = 0; i < 12; ++i) {
+    for (int8_t i = 0; i < N; ++i) {
         if ((new_pieces.stock >> i) & 1) {
             uint8_t c = i + 1;
-            int8_t c_pos = iob(board, c);
+            int8_t c_pos = iob<N>(board, c);
             // if in other player, or in itself but dead
             if ((c_pos ^ i) & 1 || (new_pieces.dead >> c_pos) & 1) {
                 new_pieces.dead |= (1 << c) >> 1;
-                new_pieces.dead_size = (new_pieces.dead_size &
-                                        (0xf << (CBI << 2))) |
-                                       (((new_pieces.dead_size >> (CB << 2)) &
-                                         0xf) +
-                                        1) << (CB << 2);
+                new_pieces.dead_size += 1 << sideShift<Player>(i);
                 new_pieces.stock &= ~((1 << c) >> 1);
                 i = -1;
             }
         }
     }
     // if multiple stock
-    for (uint8_t i = 0; i < 12; ++i) {
+    for (uint8_t i = 0; i < N; ++i) {
         if ((new_pieces.stock >> i) & 1) {
             uint8_t c = i + 1;
-            int8_t c_pos = iob(board, c);
+            int8_t c_pos = iob<N>(board, c);
             uint8_t ms = c_pos + 1;
-            int8_t ms_pos = iob(board, ms);
+            int8_t ms_pos = iob<N>(board, ms);
             uint8_t ts = ms_pos + 1;
-            int8_t ts_pos = iob(board, ts);
+            int8_t ts_pos = iob<N>(board, ts);
             if ((new_pieces.stock << 1 >> ms) & 1 &&
                 (ms_pos + 1 == c ||
                  ((new_pieces.stock << 1 >> ts) & 1 && ts_pos + 1 == c))) {
                 new_pieces.dead |= (1 << c) >> 1;
-                new_pieces.dead_size = (new_pieces.dead_size &
-                                        (0xf << (CBI << 2))) |
-                                       (((new_pieces.dead_size >> (CB << 2)) &
-                                         0xf) +
-                                        1) << (CB << 2);
+                new_pieces.dead_size += 1 << sideShift<Player>(i);
             }
         }
     }
@@ -539,18 +885,21 @@ Pieces piecesValue(uint64_t board)
     // remove empty loop
     new_pieces.running &= ~run_empty_loop;
     new_pieces.running_size -= run_empty_loop_size;
-    if ((new_pieces.running >> 5) & 1 &&
+    if ((new_pieces.running >> (half - 1)) & 1 &&
         int(run_pos_sum_exp6 & (1 << c6_pos)) == 0 &&
-        int(run_pos_sum_exp6 & (1 << pos24[c6_pos + 6])) == 0 &&
-        int(pob(board, pos24[c6_pos + 6])) == 0) {
-        new_pieces.running &= ~(1 << 5);
+        int(run_pos_sum_exp6 & (1 << pos2n<N>[c6_pos + half])) == 0 &&
+        int(pob(board, pos2n<N>[c6_pos + half])) == 0) {
+        new_pieces.running &= ~(1 << (half - 1));
         new_pieces.running_size--;
     }
     return new_pieces;
 }
 
+// Each player has N / 2 pieces to bring onto their sticks.
+template <int N>
 uint8_t posValue(uint64_t board, const Pieces &pieces_value)
 {
+    constexpr uint8_t half = N / 2;
     uint8_t my_stick = pieces_value.stick_size & 0xf;
     uint8_t your_stick = pieces_value.stick_size >> 4;
     uint8_t my_handle = (pieces_value.hand_size & 0xf) +
@@ -560,17 +909,17 @@ uint8_t posValue(uint64_t board, const Pieces &pieces_value)
     uint8_t my_dead = pieces_value.dead_size & 0xf;
     uint8_t your_dead = pieces_value.dead_size >> 4;
     // two win
-    const bool two_win = my_stick + my_handle == 6 &&
-                         your_stick + your_handle == 6 &&
+    const bool two_win = my_stick + my_handle == half &&
+                         your_stick + your_handle == half &&
                          (my_stick - your_stick <= 0 &&
                           my_stick - your_stick >= -1);
     // I win
-    const bool i_win = (my_stick == 6 && your_stick < 6) ||
-                       (my_stick + my_handle == 6 &&
+    const bool i_win = (my_stick == half && your_stick < half) ||
+                       (my_stick + my_handle == half &&
                         (your_dead > 0 || my_stick - your_stick > 0));
     // I lose
-    const bool i_lose = (my_stick < 5 && your_stick == 6) ||
-                        (your_stick + your_handle == 6 &&
+    const bool i_lose = (my_stick < half - 1 && your_stick == half) ||
+                        (your_stick + your_handle == half &&
                          (my_dead > 0 || your_stick - my_stick > 1));
     // two lose
     const bool two_lose = my_dead > 0 && your_dead > 0;
@@ -586,25 +935,154 @@ uint8_t posValue(uint64_t board, const Pieces &pieces_value)
     return 0;
 }
 
-unsigned int roll_sum = 0;
-unsigned int result_sum = 0;
-uint64_t max_depth = 0;
+// Static estimate of a node that is cut off by the depth or node cap, in
+// the same scale as posValue() with ESTIMATE_VALUE set, or unclear.
+// It weighs the piece classes of piecesValue() with the strategy notes of
+// the README: the even player suffers from its pieces on odd slots, and the
+// odd player's 1 and N - 1 (11) are hard to bring home.
+template <int N, uint8_t Player>
+uint8_t horizonValue(uint64_t board, const Pieces &pieces_value)
+{
+    constexpr uint16_t my_pieces =
+        Player ? oddPieces<N>() << 1 : oddPieces<N>();
+    constexpr uint16_t your_pieces = ~my_pieces & ((1 << N) - 1);
+    uint8_t my_dead = pieces_value.dead_size & 0xf;
+    uint8_t your_dead = pieces_value.dead_size >> 4;
+    // a dead piece can never reach its stick
+    if (my_dead > 0 && your_dead > 0) {
+        return ESTIMATE_VALUE | 2;
+    } else if (my_dead > 0) {
+        return ESTIMATE_VALUE | 1;
+    } else if (your_dead > 0) {
+        return ESTIMATE_VALUE | 4;
+    }
+    int my_score = 4 * (pieces_value.stick_size & 0xf) +
+                   3 * ((pieces_value.hand_size & 0xf) +
+                        (pieces_value.free_size & 0xf)) -
+                   2 * int(bitset<N>(pieces_value.stop & my_pieces).count());
+    int your_score =
+        4 * (pieces_value.stick_size >> 4) +
+        3 * ((pieces_value.hand_size >> 4) + (pieces_value.free_size >> 4)) -
+        2 * int(bitset<N>(pieces_value.stop & your_pieces).count());
+    // even pieces on odd slots
+    int odd_slot = 0;
+    for (uint8_t i = 0; i < N; i += 2) {
+        uint8_t c = pob(board, i);
+        if (c > 0 && !(c & 1)) {
+            odd_slot++;
+        }
+    }
+    // 1 and N - 1 still on the way
+    uint16_t placed = pieces_value.stick | pieces_value.hand |
+                      pieces_value.free;
+    int hard_odd = !(placed & 1) + !((placed >> (N - 2)) & 1);
+    if constexpr (Player == 0) {
+        my_score -= 2 * hard_odd;
+        your_score -= odd_slot;
+    } else {
+        my_score -= odd_slot;
+        your_score -= 2 * hard_odd;
+    }
+    if (my_score - your_score >= 4) {
+        return ESTIMATE_VALUE | 4;
+    } else if (your_score - my_score >= 4) {
+        return ESTIMATE_VALUE | 1;
+    }
+    return ESTIMATE_VALUE;
+}
+
+// Search state is per thread so that arena games can run side by side.
+thread_local unsigned int roll_sum = 0;
+thread_local unsigned int result_sum = 0;
+thread_local unsigned int horizon_sum = 0;
+thread_local uint64_t max_depth = 0;
+thread_local unsigned int max_roll_sum = 12000000;
+// optional wall clock limit, checked every 1024 rolls
+thread_local std::chrono::steady_clock::time_point roll_deadline =
+    std::chrono::steady_clock::time_point::max();
+// estimate cut off nodes with horizonValue() instead of leaving them at 0
+thread_local bool horizon_eval = true;
+// boards (with their depth) cut off by max_roll_sum, to be resumed later
+thread_local vector<uint64_t> frontier;
+
+// Whether the node or time budget of this search is spent. A passed
+// deadline lowers max_roll_sum, so it stays spent for the rest of it.
+inline bool rollBudgetSpent()
+{
+    if (roll_sum >= max_roll_sum) {
+        return true;
+    }
+    if ((roll_sum & 0x3ff) == 0 &&
+        roll_deadline != std::chrono::steady_clock::time_point::max() &&
+        std::chrono::steady_clock::now() >= roll_deadline) {
+        max_roll_sum = roll_sum;
+        return true;
+    }
+    return false;
+}
+
+// Set up this thread for a new search: the whole pool, an empty board_map
+// and frontier and zero counters.
+void newSearch()
+{
+    searchPool->reset();
+    if (track_board_map) {
+        for (uint32_t slot : board_map_used) {
+            board_map[slot] = 0;
+        }
+        board_map_used.clear();
+    } else {
+        std::fill(board_map, board_map + board_map_mask + 1ull, 0);
+    }
+    roll_sum = 0;
+    result_sum = 0;
+    horizon_sum = 0;
+    max_depth = 0;
+    frontier.clear();
+}
 
+template <int N>
+Position *roll(Position *pos, int8_t depth);
+
+// Player is the side to move, so both specializations are free of branches
+// on it; moves that keep or hand over the turn by a capture go back through
+// roll<N>().
+template <int N, uint8_t Player>
 Position *roll(Position *pos, int8_t depth)
 {
     roll_sum++;
     // pos value
-    Pieces pieces_value = piecesValue(pos->board);
-    uint64_t pos_value = posValue(pos->board, pieces_value);
+    Pieces pieces_value = piecesValue<N, Player>(pos->board);
+    uint64_t pos_value = posValue<N>(pos->board, pieces_value);
     pos->board |= pos_value << 60;
-    setBoardMap(pos->board);
+    // board_map entry of this node, without its value
+    uint64_t map_board = canonicalBoard<N>(pos->board) << 4 >> 4;
+    uint32_t key = getBoardMapKey<N>(map_board);
+    setBoardMap(map_board | (pos_value > 0 ? pos_value : ROLLING_VALUE) << 60,
+                key);
     pos->children.clear();
     // top max depth
     max_depth = max(depth, (int8_t)max_depth);
     pos->board &= ~(0b1111111ll << 53);
     pos->board |= (uint64_t)depth << 53;
     // end if too much
-    if (depth >= 48 || roll_sum >= 1.2e7) {
+    if (depth >= 48 || rollBudgetSpent()) {
+        if (pos_value == 0) {
+            // only the node cap leaves something to resume
+            bool open = depth < 48;
+            if (open) {
+                frontier.push_back(pos->board);
+            }
+            if (horizon_eval) {
+                horizon_sum++;
+                pos->board |= (uint64_t)horizonValue<N, Player>(
+                                  pos->board, pieces_value)
+                              << 60;
+            }
+            setBoardMap(map_board | (open ? OPEN_VALUE : pos->board >> 60)
+                                        << 60,
+                        key);
+        }
         return pos;
     }
     // end if has a value
@@ -613,7 +1091,6 @@ Position *roll(Position *pos, int8_t depth)
     }
     // roll if value is 0
     else {
-        uint8_t player = (pos->board >> 48) & 1;
         uint8_t lastmove = (pos->board >> 49) & 0xf;
         uint8_t hand_size = pieces_value.hand_size & 0xf;
         uint8_t running_size = pieces_value.running_size;
@@ -622,139 +1099,165 @@ Position *roll(Position *pos, int8_t depth)
             running_size--;
             pieces_value.running &= ~(1 << lastmove >> 1);
         }
-        // remove 12 when player == 0
-        if (!player && (pieces_value.running << 1 >> 12) & 1) {
-            running_size--;
-            pieces_value.running &= ~(1 << 12 >> 1);
+        // remove N when player == 0
+        if constexpr (Player == 0) {
+            if ((pieces_value.running << 1 >> N) & 1) {
+                running_size--;
+                pieces_value.running &= ~(1 << N >> 1);
+            }
         }
         // children size
         uint8_t children_size = hand_size + running_size;
         pos->children.resize(children_size);
-        uint8_t x = 0;
-        bool if_win = false;
+        // Children are made in two passes: first every child board and its
+        // key, prefetching its first map slot, then probe and roll. The map
+        // misses of all siblings are then in flight together instead of
+        // being paid one after another.
+        // the subtree is open if it adds to the frontier
+        size_t frontier_size = frontier.size();
+        uint64_t child_boards[N];
+        uint64_t child_map_boards[N];
+        uint32_t child_keys[N];
+        uint8_t n = 0;
         // hand's children
-        for (uint8_t i = 0; i < 12 && !if_win; i += 2) {
-            uint64_t c = (i | player) + 1;
+        for (uint8_t i = 0; i < N; i += 2) {
+            uint64_t c = (i | Player) + 1;
             if ((pieces_value.hand << 1 >> c) & 1) {
-#ifdef OBJECT_POOL_ENABLED                
-                Position *new_pos = positionPool.acquire();
-#else
-                Position *new_pos = new Position();
-#endif
-                new_pos->board = pos->board;
-                uint8_t outc = (new_pos->board << 4 >> (c << 2)) & 0xf;
+                uint64_t new_board = pos->board;
+                uint8_t outc = (new_board << 4 >> (c << 2)) & 0xf;
                 // player
-                uint64_t next_player = outc > 0 ? outc & 1 : ~player & 1;
-                new_pos->board &= ~(1ll << 48);
-                new_pos->board |= next_player << 48;
+                uint64_t next_player = outc > 0 ? outc & 1 : Player ^ 1;
+                new_board &= ~(1ll << 48);
+                new_board |= next_player << 48;
                 // hand on stick
-                new_pos->board &= ~(0xfll << (c << 2) >> 4);
-                new_pos->board |= c << (c << 2) >> 4;
+                new_board &= ~(0xfll << (c << 2) >> 4);
+                new_board |= c << (c << 2) >> 4;
                 // lastmove
-                new_pos->board &= ~(0xfll << 49);
-                new_pos->board |= c << 49;
-                // push map
-                int64_t is_set = getBoardMap(new_pos->board);
-                if (is_set == -1) {
-                    pos->children[x] = roll(new_pos, depth + 1);
-                } else {
-                    new_pos->board |= is_set << 60;
-                    pos->children[x] = new_pos;
-                }
-                // if win
-                if ((pos->children[x]->board >> 60 == 4 &&
-                     next_player == player) ||
-                    (pos->children[x]->board >> 60 == 1 &&
-                     next_player != player)) {
-                    if_win = true;
-                }
-                x++;
+                new_board &= ~(0xfll << 49);
+                new_board |= c << 49;
+                child_boards[n] = new_board;
+                child_map_boards[n] = canonicalBoard<N>(new_board);
+                child_keys[n] = getBoardMapKey<N>(child_map_boards[n]);
+                prefetch(boardMapEntry(child_keys[n]));
+                n++;
             }
         }
+        uint8_t hand_children = n;
         // running's children
-        for (uint8_t i = 0; i < 12 && !if_win; ++i) {
+        for (uint8_t i = 0; i < N; ++i) {
             uint64_t c = i + 1;
             if ((pieces_value.running << 1 >> c) & 1) {
-#ifdef OBJECT_POOL_ENABLED
-                Position *new_pos = positionPool.acquire();
-#else
-                Position *new_pos = new Position();
-#endif
-                new_pos->board = pos->board;
+                uint64_t new_board = pos->board;
                 // player
-                uint64_t next_player = ~player & 1;
-                new_pos->board &= ~(1ll << 48);
-                new_pos->board |= next_player << 48;
+                constexpr uint64_t next_player = Player ^ 1;
+                new_board &= ~(1ll << 48);
+                new_board |= next_player << 48;
                 // run on position
-                int8_t c_pos = iob(pos->board, c);
-                int8_t c_newpos = pos24[c_pos + c];
-                new_pos->board &= ~(0xfll << (c_pos << 2));
-                if (12 != c) {
-                    new_pos->board &= ~(0xfll << (c_newpos << 2));
-                    new_pos->board |= c << (c_newpos << 2);
+                int8_t c_pos = iob<N>(pos->board, c);
+                int8_t c_newpos = pos2n<N>[c_pos + c];
+                new_board &= ~(0xfll << (c_pos << 2));
+                if (N != c) {
+                    new_board &= ~(0xfll << (c_newpos << 2));
+                    new_board |= c << (c_newpos << 2);
                 }
                 // lastmove
-                new_pos->board &= ~(0xfll << 49);
-                new_pos->board |= c << 49;
-                // push map
-                int64_t is_set = getBoardMap(new_pos->board);
-                if (is_set == -1) {
-                    pos->children[x] = roll(new_pos, depth + 1);
-                } else {
-                    new_pos->board |= is_set << 60;
-                    pos->children[x] = new_pos;
-                }
-                // if win
-                if (pos->children[x]->board >> 60 == 1) {
-                    if_win = true;
-                }
-                x++;
+                new_board &= ~(0xfll << 49);
+                new_board |= c << 49;
+                child_boards[n] = new_board;
+                child_map_boards[n] = canonicalBoard<N>(new_board);
+                child_keys[n] = getBoardMapKey<N>(child_map_boards[n]);
+                prefetch(boardMapEntry(child_keys[n]));
+                n++;
+            }
+        }
+        uint8_t x = 0;
+        bool if_win = false;
+        for (; x < n && !if_win; x++) {
+#ifdef OBJECT_POOL_ENABLED
+            Position *new_pos = searchPool->acquire();
+#else
+            Position *new_pos = new Position();
+#endif
+            new_pos->board = child_boards[x];
+            uint64_t next_player = (new_pos->board >> 48) & 1;
+            // push map
+            int64_t is_set = getBoardMap(child_map_boards[x], child_keys[x]);
+            if (is_set == -1) {
+                // a hand piece may keep the turn, a running one never does
+                pos->children[x] = x < hand_children
+                                       ? roll<N>(new_pos, depth + 1)
+                                       : roll<N, Player ^ 1>(new_pos,
+                                                             depth + 1);
+            } else {
+                new_pos->board |= is_set << 60;
+                pos->children[x] = new_pos;
+            }
+            // if win
+            if ((pos->children[x]->board >> 60 == 4 &&
+                 next_player == Player) ||
+                (pos->children[x]->board >> 60 == 1 &&
+                 next_player != Player)) {
+                if_win = true;
             }
         }
         if (if_win) {
             pos->children.resize(x);
             pos->board &= ~(0xfll << 60);
             pos->board |= 4ll << 60;
-            setBoardMap(pos->board);
+            setBoardMap(map_board | (frontier.size() > frontier_size
+                                         ? OPEN_VALUE
+                                         : pos->board >> 60)
+                                        << 60,
+                        key);
         } else {
             if (children_size < 1) {
                 if (0 == lastmove) {
                     // two lose
                     pos->board &= ~(0xfll << 60);
                     pos->board |= 2ll << 60;
+                    setBoardMap(map_board | 2ll << 60, key);
                     return pos;
                 } else {
 #ifdef OBJECT_POOL_ENABLED
-                    Position *new_pos = positionPool.acquire();
+                    Position *new_pos = searchPool->acquire();
 #else
                     Position *new_pos = new Position();
 #endif
                     new_pos->board = pos->board;
                     // player
-                    uint64_t next_player = ~player & 1;
+                    constexpr uint64_t next_player = Player ^ 1;
                     new_pos->board &= ~(1ll << 48);
                     new_pos->board |= next_player << 48;
                     // lastmove is 0
                     new_pos->board &= ~(0xfll << 49);
                     // roll
-                    pos->children.push_back(roll(new_pos, depth + 1));
+                    pos->children.push_back(roll<N, Player ^ 1>(new_pos, depth + 1));
                 }
             }
             // value
             uint64_t max_value = pos->board >> 60;
+            bool estimate = false;
             for (int i = 0; i < pos->children.size(); i++) {
-                int child_value = pos->children[i]->board >> 60;
-                if ((child_value == 4 || child_value == 1) &&
-                    ((pos->children[i]->board >> 48) & 1) != player) {
-                    child_value = child_value == 4 ? 1 : 4;
+                uint8_t child_value = pos->children[i]->board >> 60;
+                if (((pos->children[i]->board >> 48) & 1) != Player) {
+                    child_value = flipValue(child_value);
                 }
-                if (max_value < child_value) {
+                estimate |= child_value & ESTIMATE_VALUE;
+                if (value_rank[max_value] < value_rank[child_value]) {
                     max_value = child_value;
                 }
             }
+            // only a proven win does not depend on the estimated children
+            if (estimate && max_value != 4) {
+                max_value |= ESTIMATE_VALUE;
+            }
             pos->board &= ~(0xfll << 60);
             pos->board |= max_value << 60;
-            setBoardMap(pos->board);
+            setBoardMap(map_board | (frontier.size() > frontier_size
+                                         ? OPEN_VALUE
+                                         : pos->board >> 60)
+                                        << 60,
+                        key);
         }
         // max depth of this pos
         uint64_t pos_depth = (pos->board >> 53) & 0b1111111;
@@ -770,13 +1273,186 @@ Position *roll(Position *pos, int8_t depth)
     return pos;
 }
 
+template <int N>
+Position *roll(Position *pos, int8_t depth)
+{
+    if ((pos->board >> 48) & 1) {
+        return roll<N, 1>(pos, depth);
+    }
+    return roll<N, 0>(pos, depth);
+}
+
+// roll() for a clock size known only at run time
+Position *rollClock(int size, Position *pos, int8_t depth)
+{
+    switch (size) {
+    case 6:
+        return roll<6>(pos, depth);
+    case 8:
+        return roll<8>(pos, depth);
+    case 10:
+        return roll<10>(pos, depth);
+    default:
+        return roll<CLOCK_SIZE>(pos, depth);
+    }
+}
+
+// A checkpoint holds the clock size and root it was made for, the frontier
+// left by max_roll_sum and every board_map entry, so that a later run can go
+// on from exactly that frontier. The clock size is needed because a board
+// of a small clock is also a board, with another value, of a larger one.
+const uint32_t CHECKPOINT_MAGIC = 0x50434343; // "CCCP"
+const uint32_t CHECKPOINT_VERSION = 2;
+
+// The checkpoint is written next to the old one and only then renamed over
+// it, so a run killed while saving keeps the previous checkpoint.
+bool saveCheckpoint(const string &file_name, int clock_size, uint64_t root)
+{
+    uint32_t clock = clock_size;
+    string tmp_name = file_name + ".tmp";
+    ofstream file(tmp_name, ios::binary | ios::trunc);
+    if (!file) {
+        cout << "Cannot write checkpoint " << tmp_name << endl;
+        return false;
+    }
+    // a board may be cut off more than once, keep its shallowest copy
+    vector<uint64_t> open_boards(frontier);
+    std::sort(open_boards.begin(), open_boards.end(),
+              [](uint64_t a, uint64_t b) {
+                  return a << 11 != b << 11 ? a << 11 < b << 11 : a < b;
+              });
+    open_boards.erase(std::unique(open_boards.begin(), open_boards.end(),
+                                  [](uint64_t a, uint64_t b) {
+                                      return a << 11 == b << 11;
+                                  }),
+                      open_boards.end());
+    uint64_t open_size = open_boards.size();
+    uint64_t map_size = board_map_mask + 1ull;
+    uint64_t entry_size = 0;
+    file.write((const char *)&CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    file.write((const char *)&CHECKPOINT_VERSION, sizeof(CHECKPOINT_VERSION));
+    file.write((const char *)&clock, sizeof(clock));
+    file.write((const char *)&root, sizeof(root));
+    file.write((const char *)&open_size, sizeof(open_size));
+    file.write((const char *)open_boards.data(), open_size * sizeof(uint64_t));
+    // other processes may fill a shared map while it is written, so the
+    // count is filled in once the entries are out
+    std::streampos entry_size_pos = file.tellp();
+    file.write((const char *)&entry_size, sizeof(entry_size));
+    // a node still being rolled, here or by another process, has no value
+    // to keep
+    for (uint64_t i = 0; i < map_size; ++i) {
+        uint64_t entry = boardMapAt(i);
+        if (entry != 0 && entry >> 60 != ROLLING_VALUE) {
+            file.write((const char *)&entry, sizeof(entry));
+            entry_size++;
+        }
+    }
+    file.seekp(entry_size_pos);
+    file.write((const char *)&entry_size, sizeof(entry_size));
+    file.close();
+    if (!file) {
+        cout << "Cannot write checkpoint " << tmp_name << endl;
+        std::remove(tmp_name.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // rename() does not replace an existing file here
+    std::remove(file_name.c_str());
+#endif
+    if (std::rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+        cout << "Cannot replace checkpoint " << file_name << " with "
+             << tmp_name << endl;
+        return false;
+    }
+    cout << "checkpoint: " << open_size << " open, " << entry_size
+         << " entries" << endl;
+    return true;
+}
+
+// Fill board_map from the checkpoint and return its frontier in resume.
+// A missing file is not an error, the search then starts afresh. Any other
+// file that is not a whole checkpoint of this root is refused before
+// board_map is touched, and the caller must not write over it.
+bool loadCheckpoint(const string &file_name, int clock_size, uint64_t root,
+                    vector<uint64_t> &resume)
+{
+    ifstream file(file_name, ios::binary | ios::ate);
+    if (!file) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        cout << "Cannot read checkpoint " << file_name << endl;
+        return false;
+    }
+    uint64_t file_size = file.tellg();
+    file.seekg(0);
+    uint32_t magic = 0, version = 0, clock = 0;
+    uint64_t saved_root = 0, open_size = 0, entry_size = 0;
+    file.read((char *)&magic, sizeof(magic));
+    file.read((char *)&version, sizeof(version));
+    file.read((char *)&clock, sizeof(clock));
+    file.read((char *)&saved_root, sizeof(saved_root));
+    if (!file || magic != CHECKPOINT_MAGIC ||
+        version != CHECKPOINT_VERSION) {
+        cout << "Not a checkpoint: " << file_name << endl;
+        return false;
+    }
+    if (clock != (uint32_t)clock_size) {
+        cout << "Checkpoint " << file_name << " is for clock " << clock
+             << endl;
+        return false;
+    }
+    if (saved_root << 11 != root << 11) {
+        cout << "Checkpoint " << file_name << " is for another position"
+             << endl;
+        coutBoard(saved_root, "checkpoint", true, clock_size);
+        return false;
+    }
+    // header, frontier, entry count and entries must fill the file exactly
+    const uint64_t header_size = 3 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+    file.read((char *)&open_size, sizeof(open_size));
+    if (file && open_size <= (file_size - header_size) / sizeof(uint64_t)) {
+        file.seekg(header_size + open_size * sizeof(uint64_t));
+        file.read((char *)&entry_size, sizeof(entry_size));
+    }
+    if (!file || entry_size > file_size / sizeof(uint64_t) ||
+        file_size != header_size + sizeof(uint64_t) +
+                         (open_size + entry_size) * sizeof(uint64_t)) {
+        cout << "Checkpoint " << file_name << " is truncated or damaged"
+             << endl;
+        return false;
+    }
+    file.seekg(header_size);
+    resume.resize(open_size);
+    file.read((char *)resume.data(), open_size * sizeof(uint64_t));
+    file.seekg(sizeof(uint64_t), ios::cur);
+    for (uint64_t i = 0; i < entry_size && file; ++i) {
+        uint64_t entry = 0;
+        file.read((char *)&entry, sizeof(entry));
+        // older files may hold nodes that were being rolled, they would
+        // read as no result
+        if (file && entry >> 60 != ROLLING_VALUE) {
+            setBoardMap(entry, getBoardMapKey(entry));
+        }
+    }
+    if (!file) {
+        cout << "Cannot read checkpoint " << file_name << endl;
+        resume.clear();
+        return false;
+    }
+    cout << "checkpoint: " << open_size << " open, " << entry_size
+         << " entries" << endl;
+    return true;
+}
+
 // 1,2,0,4,0,6,7,3,9,10,12,11;1;6
 // 1,2,0,4,0,6,7,3,9,10,12,11;1
 // 1,2,0,4,0,6,7,3,9,10,12,11
-Position initBoard(string pos_start)
+Position initBoard(string pos_start, int size = CLOCK_SIZE)
 {
 #ifdef OBJECT_POOL_ENABLED
-    Position *new_position = positionPool.acquire();
+    Position *new_position = searchPool->acquire();
 #else
     Position *new_position = new Position();
 #endif
@@ -806,7 +1482,7 @@ Position initBoard(string pos_start)
     cout << "board: ";
     pos_find = 0;
     uint64_t c = 0;
-    for (uint8_t i = 0; i < 12; i++) {
+    for (uint8_t i = 0; i < size; i++) {
         if (pos_start.find(',', pos_find) == string::npos) {
             c = stoi(pos_start.substr(pos_find));
         } else {
@@ -828,27 +1504,564 @@ Position initBoard(string pos_start)
     return *new_position;
 }
 
-int main()
+// Arena: engine settings play each other from random openings, each
+// opening once with either colour, to weigh strength against search cost.
+const int ARENA_MAX_PLY = 200;
+
+struct EngineConfig
+{
+    string name;
+    unsigned int nodes = 100000;
+    unsigned int ms = 0;
+    bool horizon = true;
+};
+
+struct ArenaStats
+{
+    unsigned int games = 0;
+    unsigned int win = 0;
+    unsigned int lose = 0;
+    unsigned int two_win = 0;
+    unsigned int two_lose = 0;
+    unsigned int unfinished = 0;
+    uint64_t moves = 0;
+    uint64_t nodes = 0;
+    double search_ms = 0;
+    double max_ms = 0;
+};
+
+struct ArenaGame
+{
+    uint64_t opening;
+    // engine of player 0 and of player 1
+    size_t engine[2];
+};
+
+// nodes=<max_roll_sum>,ms=<time per move>,eval=<0|1>; with ms and no
+// nodes only the time limits the search
+bool parseEngineConfig(const string &spec, EngineConfig &config)
+{
+    config.name = spec;
+    bool has_nodes = false;
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == string::npos) {
+            end = spec.size();
+        }
+        string item = spec.substr(start, end - start);
+        size_t eq = item.find('=');
+        if (eq == string::npos || eq + 1 == item.size()) {
+            return false;
+        }
+        string key = item.substr(0, eq);
+        unsigned int value = stoul(item.substr(eq + 1));
+        if (key == "nodes") {
+            config.nodes = value;
+            has_nodes = true;
+        } else if (key == "ms") {
+            config.ms = value;
+        } else if (key == "eval") {
+            config.horizon = value != 0;
+        } else {
+            return false;
+        }
+        start = end + 1;
+    }
+    if (config.ms > 0 && !has_nodes) {
+        config.nodes = std::numeric_limits<unsigned int>::max();
+    }
+    // the root itself takes one roll
+    return config.nodes > 1;
+}
+
+// A random start: no piece on its own slot, player 1 to move.
+template <int N = CLOCK_SIZE>
+uint64_t randomOpening(std::mt19937_64 &rng)
 {
+    uint8_t pieces[N];
+    for (uint8_t i = 0; i < N; ++i) {
+        pieces[i] = i + 1;
+    }
+    bool deranged = false;
+    while (!deranged) {
+        std::shuffle(pieces, pieces + N, rng);
+        deranged = true;
+        for (uint8_t i = 0; i < N; ++i) {
+            if (pieces[i] == i + 1) {
+                deranged = false;
+            }
+        }
+    }
+    uint64_t board = 1ll << 48;
+    for (uint8_t i = 0; i < N; ++i) {
+        board |= (uint64_t)pieces[i] << (i << 2);
+    }
+    return board;
+}
+
+template <int N = CLOCK_SIZE>
+uint8_t boardValue(uint64_t board)
+{
+    if ((board >> 48) & 1) {
+        return posValue<N>(board, piecesValue<N, 1>(board));
+    }
+    return posValue<N>(board, piecesValue<N, 0>(board));
+}
+
+// value scored for mover, seen by player
+inline uint8_t valueFor(uint8_t value, uint8_t mover, uint8_t player)
+{
+    return mover != player ? flipValue(value) : value;
+}
+
+// Play one game and return its value for player 1, 0 if unfinished. Every
+// move is a fresh search with the budget of the engine to move.
+uint8_t arenaGame(uint64_t board, const EngineConfig *engines[2],
+                  ArenaStats stats[2])
+{
+    for (int ply = 0; ply < ARENA_MAX_PLY; ++ply) {
+        uint8_t player = (board >> 48) & 1;
+        uint8_t value = boardValue(board);
+        if (value > 0) {
+            return valueFor(value, player, 1);
+        }
+        const EngineConfig &engine = *engines[player];
+        // the move is timed with its reset
+        auto start_time = std::chrono::steady_clock::now();
+        newSearch();
+        max_roll_sum = engine.nodes;
+        horizon_eval = engine.horizon;
+        roll_deadline = engine.ms > 0
+                            ? start_time +
+                                  std::chrono::milliseconds(engine.ms)
+                            : std::chrono::steady_clock::time_point::max();
+        Position *root = searchPool->acquire();
+        root->board = board;
+        roll<CLOCK_SIZE>(root, 0);
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start_time)
+                        .count();
+        stats[player].moves++;
+        stats[player].nodes += roll_sum;
+        stats[player].search_ms += ms;
+        stats[player].max_ms = max(stats[player].max_ms, ms);
+        // no move and the last one was a pass
+        if (root->children.empty()) {
+            return 2;
+        }
+        Position *best = nullptr;
+        uint8_t best_value = 0;
+        for (int i = 0; i < root->children.size(); i++) {
+            Position *child = root->children[i];
+            uint8_t child_value = valueFor(child->board >> 60,
+                                           (child->board >> 48) & 1, player);
+            if (best == nullptr ||
+                value_rank[best_value] < value_rank[child_value]) {
+                best = child;
+                best_value = child_value;
+            }
+        }
+        board = best->board << 11 >> 11;
+    }
+    return 0;
+}
+
+void arenaWorker(const vector<EngineConfig> &engines,
+                 const vector<ArenaGame> &games, std::atomic<size_t> &next,
+                 vector<ArenaStats> &stats, std::mutex &stats_mutex)
+{
+    // rolls of the largest search; a time budget is sized for 3000 rolls
+    // per ms, a little over what one arena thread manages
+    unsigned int max_nodes = 0;
+    for (const EngineConfig &engine : engines) {
+        uint64_t nodes = engine.nodes;
+        if (engine.ms > 0) {
+            nodes = min<uint64_t>(nodes, 3000ull * engine.ms);
+        }
+        max_nodes = max<uint64_t>(max_nodes, nodes);
+    }
+    ObjectPool<Position> pool(poolSize(max_nodes));
+    searchPool = &pool;
+    track_board_map = true;
+    uint64_t map_size = boardMapSize(max_nodes);
+    vector<uint64_t> map(map_size);
+    board_map = map.data();
+    board_map_mask = map_size - 1;
+
+    for (size_t g = next++; g < games.size(); g = next++) {
+        const EngineConfig *players[2] = {&engines[games[g].engine[0]],
+                                          &engines[games[g].engine[1]]};
+        ArenaStats game_stats[2];
+        uint8_t result = arenaGame(games[g].opening, players, game_stats);
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        for (uint8_t p = 0; p < 2; ++p) {
+            ArenaStats &engine_stats = stats[games[g].engine[p]];
+            engine_stats.games++;
+            switch (result == 0 ? 0 : valueFor(result, 1, p)) {
+            case 4:
+                engine_stats.win++;
+                break;
+            case 3:
+                engine_stats.two_win++;
+                break;
+            case 2:
+                engine_stats.two_lose++;
+                break;
+            case 1:
+                engine_stats.lose++;
+                break;
+            default:
+                engine_stats.unfinished++;
+                break;
+            }
+            engine_stats.moves += game_stats[p].moves;
+            engine_stats.nodes += game_stats[p].nodes;
+            engine_stats.search_ms += game_stats[p].search_ms;
+            engine_stats.max_ms = max(engine_stats.max_ms,
+                                      game_stats[p].max_ms);
+        }
+    }
+}
+
+// chaosclock arena [games <n>] [threads <n>] [seed <n>] engine <spec> ...
+int arena(int argc, char *argv[])
+{
+    unsigned int openings = 50;
+    unsigned int threads = max(1u, std::thread::hardware_concurrency());
+    uint64_t seed = 1;
+    vector<EngineConfig> engines;
+    for (int i = 0; i < argc; i += 2) {
+        string option = argv[i];
+        if (i + 1 >= argc) {
+            cout << "Missing value for " << option << endl;
+            return 1;
+        } else if (option == "games") {
+            openings = stoul(argv[i + 1]);
+        } else if (option == "threads") {
+            threads = max(1ul, stoul(argv[i + 1]));
+        } else if (option == "seed") {
+            seed = stoull(argv[i + 1]);
+        } else if (option == "engine") {
+            EngineConfig engine;
+            if (!parseEngineConfig(argv[i + 1], engine)) {
+                cout << "Bad engine " << argv[i + 1]
+                     << ", expected nodes=<n>,ms=<n>,eval=<0|1>" << endl;
+                return 1;
+            }
+            engines.push_back(engine);
+        } else {
+            cout << "Unknown option " << option << endl;
+            return 1;
+        }
+    }
+    if (engines.size() < 2) {
+        cout << "arena needs at least two engines, e.g. "
+                "engine nodes=200000 engine nodes=20000,eval=0"
+             << endl;
+        return 1;
+    }
+
+    // every pair of engines plays every opening with both colours
+    std::mt19937_64 rng(seed);
+    vector<ArenaGame> games;
+    for (unsigned int o = 0; o < openings; ++o) {
+        uint64_t opening = randomOpening(rng);
+        for (size_t a = 0; a < engines.size(); ++a) {
+            for (size_t b = a + 1; b < engines.size(); ++b) {
+                games.push_back({opening, {a, b}});
+                games.push_back({opening, {b, a}});
+            }
+        }
+    }
+    cout << "arena: " << games.size() << " games, " << threads
+         << " threads" << endl;
+
+    auto start_time = std::chrono::steady_clock::now();
+    vector<ArenaStats> stats(engines.size());
+    std::mutex stats_mutex;
+    std::atomic<size_t> next {0};
+    vector<std::thread> workers;
+    for (unsigned int t = 0; t < threads; ++t) {
+        workers.emplace_back(arenaWorker, std::cref(engines),
+                             std::cref(games), std::ref(next),
+                             std::ref(stats), std::ref(stats_mutex));
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time);
+
+    cout << left << setw(28) << "engine" << right << setw(7) << "games"
+         << setw(6) << "win" << setw(6) << "lose" << setw(9) << "two_win"
+         << setw(10) << "two_lose" << setw(8) << "unfin" << setw(12)
+         << "nodes/s" << setw(10) << "ms/move" << setw(10) << "max_ms"
+         << endl;
+    for (size_t e = 0; e < engines.size(); ++e) {
+        const ArenaStats &s = stats[e];
+        double seconds = s.search_ms / 1000;
+        cout << left << setw(28) << engines[e].name << right << setw(7)
+             << s.games << setw(6) << s.win << setw(6) << s.lose << setw(9)
+             << s.two_win << setw(10) << s.two_lose << setw(8)
+             << s.unfinished << setw(12) << fixed << setprecision(0)
+             << (seconds > 0 ? s.nodes / seconds : 0) << setw(10)
+             << setprecision(2) << (s.moves > 0 ? s.search_ms / s.moves : 0)
+             << setw(10) << s.max_ms << endl;
+    }
+    cout << "Arena took " << duration.count() << " ms" << endl;
+    return 0;
+}
+
+// Scaling study: solve random openings of several clock sizes, each with an
+// empty board_map, and compare the search cost. The small clocks are solved
+// exactly in seconds, so their values also serve as a regression oracle for
+// changes to the rules or the search.
+struct ScaleStats
+{
+    unsigned int openings = 0;
+    unsigned int exact = 0;
+    unsigned int values[5] = {};
+    uint64_t nodes = 0;
+    unsigned int max_nodes = 0;
+    uint8_t max_depth = 0;
+    double search_ms = 0;
+    double max_ms = 0;
+    // most positions one search took from outside the pool
+    size_t overflow = 0;
+};
+
+template <int N>
+ScaleStats scaleClock(unsigned int openings, uint64_t seed, bool list)
+{
+    ScaleStats stats;
+    std::mt19937_64 rng(seed);
+    for (unsigned int o = 0; o < openings; ++o) {
+        uint64_t opening = randomOpening<N>(rng);
+        auto start_time = std::chrono::steady_clock::now();
+        newSearch();
+        Position *root = searchPool->acquire();
+        root->board = opening;
+        roll<N>(root, 0);
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start_time)
+                        .count();
+        uint8_t value = root->board >> 60;
+        bool exact = !(value & ESTIMATE_VALUE);
+        value &= 7;
+        stats.openings++;
+        stats.exact += exact;
+        stats.values[value]++;
+        stats.nodes += roll_sum;
+        stats.max_nodes = max(stats.max_nodes, roll_sum);
+        stats.max_depth = max(stats.max_depth, (uint8_t)max_depth);
+        stats.search_ms += ms;
+        stats.max_ms = max(stats.max_ms, ms);
+        stats.overflow = max(stats.overflow, searchPool->count);
+        if (list) {
+            for (uint8_t i = 0; i < N; ++i) {
+                cout << int((opening >> (i << 2)) & 0xf)
+                     << (i + 1 < N ? "," : ";1 ");
+            }
+            cout << "value: " << int(value) << (exact ? "" : "?")
+                 << " ; roll_sum: " << roll_sum << endl;
+        }
+    }
+    return stats;
+}
+
+// chaosclock scale [games <n>] [seed <n>] [nodes <n>] [list <0|1>]
+//                  [clock <N>] ...
+int scale(int argc, char *argv[])
+{
+    unsigned int openings = 50;
+    uint64_t seed = 1;
+    bool list = false;
+    vector<int> sizes;
+    for (int i = 0; i < argc; i += 2) {
+        string option = argv[i];
+        if (i + 1 >= argc) {
+            cout << "Missing value for " << option << endl;
+            return 1;
+        } else if (option == "games") {
+            openings = stoul(argv[i + 1]);
+        } else if (option == "seed") {
+            seed = stoull(argv[i + 1]);
+        } else if (option == "nodes") {
+            max_roll_sum = stoul(argv[i + 1]);
+        } else if (option == "list") {
+            list = stoi(argv[i + 1]) != 0;
+        } else if (option == "clock") {
+            int size = stoi(argv[i + 1]);
+            if (size != 6 && size != 8 && size != 10 && size != CLOCK_SIZE) {
+                cout << "Bad clock " << size << ", expected 6, 8, 10 or 12"
+                     << endl;
+                return 1;
+            }
+            sizes.push_back(size);
+        } else {
+            cout << "Unknown option " << option << endl;
+            return 1;
+        }
+    }
+    if (sizes.empty()) {
+        sizes = {6, 8, 10};
+    }
+
+    uint64_t map_size = boardMapSize(max_roll_sum);
+    vector<uint64_t> map(map_size);
+    board_map = map.data();
+    board_map_mask = map_size - 1;
+    ObjectPool<Position> pool(poolSize(max_roll_sum));
+    searchPool = &pool;
+    track_board_map = true;
+
+    vector<ScaleStats> stats;
+    for (int size : sizes) {
+        if (list) {
+            cout << "clock " << size << ":" << endl;
+        }
+        switch (size) {
+        case 6:
+            stats.push_back(scaleClock<6>(openings, seed, list));
+            break;
+        case 8:
+            stats.push_back(scaleClock<8>(openings, seed, list));
+            break;
+        case 10:
+            stats.push_back(scaleClock<10>(openings, seed, list));
+            break;
+        default:
+            stats.push_back(scaleClock<CLOCK_SIZE>(openings, seed, list));
+            break;
+        }
+    }
+    size_t overflow = 0;
+    for (const ScaleStats &s : stats) {
+        overflow = max(overflow, s.overflow);
+    }
+    if (overflow > 0) {
+        cout << "Warning: Insufficient object pool size, up to " << overflow
+             << " positions allocated outside it" << endl;
+    }
+
+    cout << right << setw(6) << "clock" << setw(7) << "games" << setw(7)
+         << "exact" << setw(6) << "win" << setw(9) << "two_win" << setw(10)
+         << "two_lose" << setw(6) << "lose" << setw(12) << "nodes" << setw(12)
+         << "max_nodes" << setw(7) << "depth" << setw(10) << "ms" << setw(10)
+         << "max_ms" << endl;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        const ScaleStats &s = stats[i];
+        unsigned int games = max(1u, s.openings);
+        cout << setw(6) << sizes[i] << setw(7) << s.openings << setw(7)
+             << s.exact << setw(6) << s.values[4] << setw(9) << s.values[3]
+             << setw(10) << s.values[2] << setw(6) << s.values[1] << setw(12)
+             << s.nodes / games << setw(12) << s.max_nodes << setw(7)
+             << int(s.max_depth) << setw(10) << fixed << setprecision(2)
+             << s.search_ms / games << setw(10) << s.max_ms << endl;
+    }
+    return 0;
+}
+
+// chaosclock [checkpoint <file>] [nodes <max_roll_sum>] [shm <name>]
+//            [clock <N>]
+// chaosclock arena ...
+// chaosclock scale ...
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && string(argv[1]) == "arena") {
+        return arena(argc - 2, argv + 2);
+    }
+    if (argc > 1 && string(argv[1]) == "scale") {
+        return scale(argc - 2, argv + 2);
+    }
+
     auto start_time = std::chrono::high_resolution_clock::now();
 
+    // options
+    string checkpoint_file;
+    string shm_name;
+    int clock_size = CLOCK_SIZE;
+    for (int i = 1; i < argc; i += 2) {
+        string option = argv[i];
+        if (i + 1 >= argc) {
+            cout << "Missing value for " << option << endl;
+            return 1;
+        } else if (option == "checkpoint") {
+            checkpoint_file = argv[i + 1];
+        } else if (option == "nodes") {
+            max_roll_sum = stoul(argv[i + 1]);
+        } else if (option == "shm") {
+            shm_name = argv[i + 1];
+        } else if (option == "clock") {
+            clock_size = stoi(argv[i + 1]);
+            if (clock_size != 6 && clock_size != 8 && clock_size != 10 &&
+                clock_size != CLOCK_SIZE) {
+                cout << "Bad clock " << clock_size
+                     << ", expected 6, 8, 10 or 12" << endl;
+                return 1;
+            }
+        } else {
+            cout << "Unknown option " << option << endl;
+            return 1;
+        }
+    }
+
     // read position
     string pos_start;
     fstream my_file("bcpos.txt");
     getline(my_file, pos_start);
     my_file.close();
 
-    board_map = new uint64_t[1ll << 27];
-    std::fill(board_map, board_map + (1ll << 27), 0);
+    if (!shm_name.empty()) {
+        if (!attachSharedBoardMap(shm_name, clock_size)) {
+            return 1;
+        }
+    } else {
+        board_map = new uint64_t[1ll << 27];
+        std::fill(board_map, board_map + (1ll << 27), 0);
+    }
 
-    Position pos = initBoard(pos_start);
-    Position *result_pos = roll(&pos, 0);
-    delete board_map;
+    ObjectPool<Position> pool(poolSize(max_roll_sum));
+    searchPool = &pool;
+    Position pos = initBoard(pos_start, clock_size);
+    // roll the saved frontier first, then the root finds it in board_map
+    vector<uint64_t> resume;
+    if (!checkpoint_file.empty()) {
+        // a file that cannot be resumed is left as it is
+        if (!loadCheckpoint(checkpoint_file, clock_size, pos.board,
+                            resume)) {
+            if (shared_map != nullptr) {
+                detachSharedBoardMap();
+            }
+            return 1;
+        }
+        for (uint64_t board : resume) {
+#ifdef OBJECT_POOL_ENABLED
+            Position *new_pos = searchPool->acquire();
+#else
+            Position *new_pos = new Position();
+#endif
+            new_pos->board = board << 11 >> 11;
+            rollClock(clock_size, new_pos, (board >> 53) & 0b1111111);
+        }
+    }
+    Position *result_pos = rollClock(clock_size, &pos, 0);
+    if (!checkpoint_file.empty()) {
+        saveCheckpoint(checkpoint_file, clock_size, pos.board);
+    }
+    if (shared_map != nullptr) {
+        detachSharedBoardMap();
+    } else {
+        delete board_map;
+    }
 
     string pick_child;
     cout << "roll_sum:" << roll_sum << endl;
     cout << "max_depth:" << (int)max_depth << endl;
     cout << "result_sum:" << result_sum << endl;
+    cout << "horizon_sum:" << horizon_sum << endl;
+    cout << "frontier:" << frontier.size() << endl;
     cout << endl;
     // start game
     stack<Position *> poslist;
@@ -861,15 +2074,15 @@ int main()
         end_time - start_time);
     std::cout << "Stage 1 took " << duration.count() << " ms" << std::endl;
 
-    if (positionPool.count > 0) {
+    if (pool.count > 0) {
         std::cout << "Warning: Insufficient object pool size, consider increasing by "
-                  << positionPool.count
+                  << pool.count
                   << " bytes!" << endl;
     }
 
     do {
         coutMovelist(movelist);
-        coutBoard(poslist.top()->board);
+        coutBoard(poslist.top()->board, "roll", true, clock_size);
         cout << "this_depth: " << this_depth;
         cout << " ; available move:" << poslist.top()->children.size() << endl;
         for (size_t lm = 0; lm < poslist.top()->children.size(); lm++) {